@@ -9,11 +9,17 @@ and pack voltages, interfacing with the max14921 over spi and balancing cells
 #include <Adafruit_ADS1X15.h>
 #include <ShiftRegister74HC595.h>
 #include <CircularBuffer.h>
+#include <calibration.h>
 
 float to_voltage(int adc_val) {
     return (float)adc_val * ADC_CONST;
 }
 
+//oversampled sum of adc counts to volts
+float counts_to_voltage(int32_t counts) {
+    return (float)counts * ADC_CONST / (1 << OVERSAMPLE_BITS);
+}
+
 
 MAX14921::MAX14921(uint8_t cs1, uint8_t cs2, uint8_t en1, uint8_t en2) {
     pack_data[0].cs = cs1;
@@ -21,6 +27,13 @@ MAX14921::MAX14921(uint8_t cs1, uint8_t cs2, uint8_t en1, uint8_t en2) {
     pack_data[0].en = en1;
     pack_data[1].en = en2;
     average_pack_voltage = 0;
+    cell_settling = CELL_SETTLING;
+    aout_settling = AOUT_SETTLING;
+    filter_len = CIRC_BUFF_LEN;
+    oversample = OVERSAMPLE;
+    cal = NULL;
+    memset(&stats, 0, sizeof(stats));
+    scanned_packs = 0;
 }
 
 void MAX14921::begin() {
@@ -30,6 +43,8 @@ void MAX14921::begin() {
         ads1115[i].begin(ADC_ADDR[i]);
 
         ads1115[i].setGain(GAIN_TWOTHIRDS);
+        //fastest rate so oversampling doesn't cost more time than a single slow read
+        ads1115[i].setDataRate(ADC_DATA_RATE);
 
         pinMode(pack_data[i].cs, OUTPUT);
         digitalWrite(pack_data[i].cs, HIGH);
@@ -51,6 +66,8 @@ void MAX14921::sleep() {
 
 
 void MAX14921::wake() {
+    //averages are stale until every pack has been scanned again
+    scanned_packs = 0;
     for(int i = 0; i < NUM_PACKS; i++){
         sr.set(pack_data[i].en, HIGH);
         spiTransfer24(pack_data[i].cs, 0x00, 0x00, 0x03 << 3);
@@ -66,18 +83,86 @@ void MAX14921::reset_balance() {
 }
 
 
+//settling times are in ms for the sample phase and us for aout
+void MAX14921::set_settling(uint8_t cell_settling, uint8_t aout_settling) {
+    this->cell_settling = cell_settling;
+    this->aout_settling = aout_settling;
+}
+
+//shorter window follows the cells faster, longer one filters more noise
+void MAX14921::set_filter_len(uint8_t len) {
+    filter_len = constrain(len, 1, CIRC_BUFF_LEN);
+}
+
+
+//slower data rate is quieter per read, more reads per sample average noise down.
+//both set how long a scan takes
+void MAX14921::set_adc(uint16_t data_rate, uint8_t oversample) {
+    this->oversample = max(oversample, (uint8_t)1);
+    for(int i = 0; i < NUM_PACKS; i++) {
+        ads1115[i].setDataRate(data_rate);
+    }
+}
+
+
+//readings are used uncorrected until a calibration table is set
+void MAX14921::set_calibration(Calibration *cal) {
+    this->cal = cal;
+}
+
+
+//also works out the pack stats in the same pass over the cells
 void MAX14921::update_cell_average() {
+    float sum = 0;
+    float sum_sq = 0;
+    stats.min = INFINITY;
+    stats.max = -INFINITY;
+
     //moving average filter is the best filter imo.
     //maybe could do a cheaky digital low pass filter?
     for(int i = 0; i < NUM_PACKS; i++) {
         for(int j = 0; j < NUM_CELLS; j++) {
-            float cell_average = 0;
-            int len = pack_data[i].cell_voltages[j].size();
-            for(int m = 0; m < len; m++) {
-                cell_average += pack_data[i].cell_voltages[j][m];
+            int size = pack_data[i].cell_voltages[j].size();
+            int len = min(size, (int)filter_len);
+            if(len) {
+                float cell_average = 0;
+                //newest samples are at the end of the buffer
+                for(int m = size - len; m < size; m++) {
+                    cell_average += pack_data[i].cell_voltages[j][m];
+                }
+                cell_average /= len;
+                pack_data[i].cell_average_voltages[j] = cell_average;
+            }
+            if(!(MEASURED_CELLS & (1 << j))) {
+                continue;
+            }
+
+            float cell_voltage = pack_data[i].cell_average_voltages[j];
+            sum += cell_voltage;
+            sum_sq += cell_voltage * cell_voltage;
+            if(cell_voltage < stats.min) {
+                stats.min = cell_voltage;
+                stats.min_pack = i;
+                stats.min_cell = j;
+            }
+            if(cell_voltage > stats.max) {
+                stats.max = cell_voltage;
+                stats.max_pack = i;
+                stats.max_cell = j;
             }
-            cell_average /= len;
-            pack_data[i].cell_average_voltages[j] = cell_average;
+        }
+    }
+
+    const int count = NUM_PACKS * NUM_MEASURED_CELLS;
+    stats.mean = sum / count;
+    stats.spread = stats.max - stats.min;
+    //clamp rounding error, variance can come out a hair under zero
+    stats.stddev = sqrt(max(sum_sq / count - stats.mean * stats.mean, 0.0f));
+
+    for(int i = 0; i < NUM_PACKS; i++) {
+        for(int j = 0; j < NUM_CELLS; j++) {
+            stats.deviation[i][j] = (MEASURED_CELLS & (1 << j))
+                ? pack_data[i].cell_average_voltages[j] - stats.mean : 0;
         }
     }
 }
@@ -120,6 +205,34 @@ long MAX14921::spiTransfer24(int cs_pin, uint8_t byte1, uint8_t byte2, uint8_t b
     return(return_data);
 }
 
+//average of oversample reads scaled to OVERSAMPLE_BITS of extra resolution for
+//the integer correction pass. with the default OVERSAMPLE reads that is the sum
+//shifted down, fewer reads give the same units with less real resolution
+int32_t MAX14921::read_adc(uint8_t pack) {
+    int32_t counts = 0;
+    for(int i = 0; i < oversample; i++) {
+        counts += ads1115[pack].readADC_SingleEnded(0);
+    }
+    return (counts << OVERSAMPLE_BITS) / oversample;
+}
+
+//one uncorrected oversampled reading of a cell, or CAL_PACK_CHANNEL for the
+//pack divider. a calibration point averages several, one per job run, so the
+//loop isn't blocked for the whole capture
+int32_t MAX14921::read_raw(uint8_t pack, uint8_t channel) {
+    spiTransfer24(pack_data[pack].cs, pack_data[pack].balance_byte1, pack_data[pack].balance_byte2, 0x03 << 3);
+    if(channel >= NUM_CELLS) {
+        delayMicroseconds(PACK_VOLTAGE_SETTLING);
+    } else {
+        delay(cell_settling);
+        spiTransfer24(pack_data[pack].cs, pack_data[pack].balance_byte1, pack_data[pack].balance_byte2, (CELL_SELECT | SAMPLB));
+        delayMicroseconds(LEVEL_SHIFT_DELAY);
+        spiTransfer24(pack_data[pack].cs, pack_data[pack].balance_byte1, pack_data[pack].balance_byte2, CELL_SELECT | (channel << 1) | SAMPLB);
+        delayMicroseconds(aout_settling * 2);
+    }
+    return read_adc(pack);
+}
+
 //finds average voltage for each cell, then multiplies by the number of cells
 //in the pack
 float MAX14921::get_pack_voltage() {
@@ -129,8 +242,11 @@ float MAX14921::get_pack_voltage() {
         spiTransfer24(pack_data[i].cs, pack_data[i].balance_byte1, pack_data[i].balance_byte2, 0x03 << 3);
         delayMicroseconds(PACK_VOLTAGE_SETTLING);
 
-        int16_t adc_val = ads1115[i].readADC_SingleEnded(0); 
-        total_pack_voltage += to_voltage(adc_val) * 16;
+        int32_t counts = read_adc(i);
+        if(cal) {
+            counts = cal->correct(i, CAL_PACK_CHANNEL, counts);
+        }
+        total_pack_voltage += counts_to_voltage(counts) * PACK_DIVIDER;
     }
 
     #ifdef DEBUG
@@ -147,27 +263,13 @@ float MAX14921::get_pack_voltage() {
 
 //checks if any cell in pack is over the thresh voltage
 uint8_t MAX14921::over_voltage() {
-    for(int i = 0; i < NUM_PACKS; i++) {
-        for(int j = 0; j < NUM_CELLS; j++) {
-            if (pack_data[i].cell_average_voltages[j] > CELL_THRESH_UPPER){
-                return 1;
-            }
-        }
-    }
-    return 0;
+    return stats.max > CELL_THRESH_UPPER;
 }
 
 
 //checks if any cell in pack is under the thresh voltage
 uint8_t MAX14921::under_voltage() {
-    for(int i = 0; i < NUM_PACKS; i++) {
-        for(int j = 0; j < NUM_CELLS; j++) {
-            if (pack_data[i].cell_average_voltages[j] < CELL_THRESH_LOWER){
-                return 1;
-            }
-        }
-    }
-    return 0;
+    return stats.min < CELL_THRESH_LOWER;
 }
 
 
@@ -191,23 +293,22 @@ uint8_t MAX14921::over_temp() {
 void MAX14921::balance_cells() {
     //balances cells if a cell crosses the set threshold voltage (4.15V)
     //uses previously calculated cell voltages to determine if a particular cell needs to be blanced
+    //nothing to check per cell if even the highest is under the threshold
+    bool any_high = stats.max >= CELL_THRESH_UPPER;
     for(int i = 0; i < NUM_PACKS; i++) {
-        for(uint8_t j = 0; j < NUM_CELLS; j++) {
-            if (pack_data[i].cell_average_voltages[j] >= CELL_THRESH_UPPER && j != 12 && j != 13) {
-                pack_data[i].cell_balancing[j] = 1;
-            } else {
-                pack_data[i].cell_balancing[j] = 0;
-            }
-        }
         pack_data[i].balance_byte1 = 0;
         pack_data[i].balance_byte2 = 0;
-        for(uint8_t j = 0; j < NUM_CELLS; j++) {
-            if(j / 8) {
-                pack_data[i].balance_byte2 |= pack_data[i].cell_balancing[j] << (j % 8);
-            } else {
-                pack_data[i].balance_byte1 |= pack_data[i].cell_balancing[j] << (j % 8);
+        if (!any_high) {
+            memset(pack_data[i].cell_balancing, 0, sizeof(pack_data[i].cell_balancing));
+        } else {
+            for(uint8_t j = 0; j < NUM_CELLS; j++) {
+                pack_data[i].cell_balancing[j] = pack_data[i].cell_average_voltages[j] >= CELL_THRESH_UPPER && j != 12 && j != 13;
+                if(j / 8) {
+                    pack_data[i].balance_byte2 |= pack_data[i].cell_balancing[j] << (j % 8);
+                } else {
+                    pack_data[i].balance_byte1 |= pack_data[i].cell_balancing[j] << (j % 8);
+                }
             }
-            
         }
         //set balance to true if either pack needs balancing
         spiTransfer24(pack_data[i].cs, pack_data[i].balance_byte1, pack_data[i].balance_byte2, 0x03 << 3);
@@ -215,51 +316,99 @@ void MAX14921::balance_cells() {
     }
 }
 
-//read the voltage of each cell and store in array, returns the array
+//read the voltage of each cell in every pack and store in array
 void MAX14921::record_cell_voltages() {
-    //sample bit set to hold, 100000
     for(int i = 0; i < NUM_PACKS; i++) {
-        //put max14921 into sample phase for 60ms
-        spiTransfer24(pack_data[i].cs, pack_data[i].balance_byte1, pack_data[i].balance_byte2, 0x03 << 3);
-        delay(CELL_SETTLING);
+        record_cell_voltages(i);
+    }
+}
 
-        //change into hold phase and delay for 50us to allow for level shift
-        spiTransfer24(pack_data[i].cs, pack_data[i].balance_byte1, pack_data[i].balance_byte2, (CELL_SELECT | SAMPLB));
-        delayMicroseconds(LEVEL_SHIFT_DELAY);
+//read the voltage of each cell in a single pack, lets the scheduler slice a scan
+//into one pack per job run so nothing else waits on the whole stack. cell_mask
+//picks which cells to read so suspect cells can be rechecked on their own
+void MAX14921::record_cell_voltages(uint8_t i, uint16_t cell_mask) {
+    //sample bit set to hold, 100000
+    //put max14921 into sample phase, 60ms by default
+    spiTransfer24(pack_data[i].cs, pack_data[i].balance_byte1, pack_data[i].balance_byte2, 0x03 << 3);
+    delay(cell_settling);
+
+    //change into hold phase and delay for 50us to allow for level shift
+    spiTransfer24(pack_data[i].cs, pack_data[i].balance_byte1, pack_data[i].balance_byte2, (CELL_SELECT | SAMPLB));
+    delayMicroseconds(LEVEL_SHIFT_DELAY);
+
+    //should be read out from top of stack down but oh well
+    for(uint8_t cell_num = 0; cell_num < NUM_CELLS; cell_num++){
+        if(!(cell_mask & (1 << cell_num))) {
+            continue;
+        }
 
-        //should be read out from top of stack down but oh well
-        for(uint8_t cell_num = 0; cell_num < NUM_CELLS; cell_num++){
+        byte sample_cell = CELL_SELECT | (cell_num << 1) | SAMPLB;
+        //hold cell voltage for reading
+        long return_data = spiTransfer24(pack_data[i].cs, pack_data[i].balance_byte1, pack_data[i].balance_byte2, sample_cell);
+        delayMicroseconds(aout_settling * 2);
 
-            byte sample_cell = CELL_SELECT | (cell_num << 1) | SAMPLB;
-            //hold cell voltage for reading
-            long return_data = spiTransfer24(pack_data[i].cs, pack_data[i].balance_byte1, pack_data[i].balance_byte2, sample_cell);
-            delayMicroseconds(AOUT_SETTLING * 2);
+        scan_buffer[cell_num] = read_adc(i);
 
-            int16_t adc_val = ads1115[i].readADC_SingleEnded(0);
+        #ifdef DEBUG
+        if(return_data & 0xFF) {
+            Serial.println("Cell above or below threshold voltage");
+        }
+        #endif
+    }
 
-            #ifdef DEBUG
-            if(return_data & 0xFF) {
-                Serial.println("Cell above or below threshold voltage");
-            }
-            #endif
-
-            //turn float voltage into truncated char array
-            float cell_voltage = to_voltage(adc_val);
-            //unsafe hack to stop weird stuff will cell 13
-            if(cell_num == 12 || cell_num == 13) {
-                pack_data[i].cell_voltages[cell_num].push(pack_data[i].cell_voltages[11].last());
-            } else {
-                pack_data[i].cell_voltages[cell_num].push(cell_voltage);
-            }
-            
-            //Serial.println(cell_voltage);
+    //offset and gain correction in one integer pass over the scan
+    if(cal) {
+        cal->correct_all(i, scan_buffer, cell_mask);
+    }
+
+    for(uint8_t cell_num = 0; cell_num < NUM_CELLS; cell_num++){
+        if(!(cell_mask & (1 << cell_num))) {
+            continue;
+        }
+
+        float cell_voltage = counts_to_voltage(scan_buffer[cell_num]);
+        //unsafe hack to stop weird stuff will cell 13
+        if(cell_num == 12 || cell_num == 13) {
+            pack_data[i].cell_voltages[cell_num].push(pack_data[i].cell_voltages[11].last());
+        } else {
+            pack_data[i].cell_voltages[cell_num].push(cell_voltage);
         }
     }
 
+    if(cell_mask == ALL_CELLS) {
+        scanned_packs |= 1 << i;
+    }
+
     //update values in cell average array
     update_cell_average();
 }
 
+const pack_stats_t *MAX14921::get_stats() {
+    return &stats;
+}
+
+//true once every pack has had a full scan since boot or the last wake, before
+//that the packs not yet scanned still read 0V and would look undervoltage
+bool MAX14921::stack_valid() {
+    return scanned_packs == (1 << NUM_PACKS) - 1;
+}
+
 float MAX14921::get_cell_voltage(uint8_t pack, uint8_t cell) {
     return pack_data[pack].cell_average_voltages[cell];
+}
+
+//average of the newest window samples regardless of the filter length, for
+//rates of change that shouldn't step when the filter window does
+float MAX14921::get_cell_recent(uint8_t pack, uint8_t cell, uint8_t window) {
+    CircularBuffer<float, CIRC_BUFF_LEN> *samples = &pack_data[pack].cell_voltages[cell];
+    int size = samples->size();
+    int len = min(size, (int)window);
+    if(!len) {
+        return 0;
+    }
+    float sum = 0;
+    for(int m = size - len; m < size; m++) {
+        sum += (*samples)[m];
+    }
+    return sum / len;
 }
\ No newline at end of file
@@ -33,6 +33,14 @@ const uint8_t NUM_PACKS = 2;
 const uint8_t CIRC_BUFF_LEN = 20;
 const uint8_t AOUT_SETTLING = 5; // in useconds
 const uint8_t PACK_VOLTAGE_SETTLING = 50; // in useconds
+const uint8_t PACK_DIVIDER = 16; // aout is the pack voltage divided by 16
+
+//each extra bit of resolution takes 4x the reads. counts are always in units of
+//1/2^OVERSAMPLE_BITS of an adc lsb whatever the read count, so calibration holds
+//when the acquisition policy trades reads for speed
+const uint8_t OVERSAMPLE_BITS = 1;
+const uint8_t OVERSAMPLE = 1 << (2 * OVERSAMPLE_BITS); // default adc reads per sample
+const uint16_t ADC_DATA_RATE = RATE_ADS1115_860SPS; // default
 
 const int ADC_ADDR[NUM_PACKS] = {0x48, 0x49};
 const float CELL_THRESH_UPPER = 4.1;
@@ -40,6 +48,11 @@ const float CELL_THRESH_LOWER = 3.4;
 const int SPI_MAX_RATE = 50000;
 const uint8_t NUM_CELLS = 15;
 const uint8_t CELL_SETTLING = 60;
+const uint16_t ALL_CELLS = (1 << NUM_CELLS) - 1;
+//cells 12 and 13 just repeat cell 11, see record_cell_voltages, so they are left
+//out of the pack stats rather than counting cell 11 three times
+const uint16_t MEASURED_CELLS = ALL_CELLS & ~((1 << 12) | (1 << 13));
+const uint8_t NUM_MEASURED_CELLS = NUM_CELLS - 2;
 
 typedef struct {
     float cell_average_voltages[NUM_CELLS];
@@ -51,14 +64,40 @@ typedef struct {
     uint8_t cs;
 } pack_data_t;
 
+//pack health from the latest cell averages, worked out once per scan so the
+//threshold checks, balancing and telemetry all share it
+typedef struct {
+    float min;
+    uint8_t min_pack;
+    uint8_t min_cell;
+    float max;
+    uint8_t max_pack;
+    uint8_t max_cell;
+    float spread;
+    float mean;
+    float stddev;
+    float deviation[NUM_PACKS][NUM_CELLS]; // from the mean, in volts, 0 for cells not in MEASURED_CELLS
+} pack_stats_t;
+
+class Calibration;
+
 class MAX14921 {
     public:
         MAX14921(uint8_t cs1, uint8_t cs2, uint8_t en1, uint8_t en2);
         void begin();
         void balance_cells();
         void record_cell_voltages();
+        void record_cell_voltages(uint8_t pack, uint16_t cell_mask = ALL_CELLS);
+        void set_settling(uint8_t cell_settling, uint8_t aout_settling);
+        void set_filter_len(uint8_t len);
+        void set_adc(uint16_t data_rate, uint8_t oversample);
+        void set_calibration(Calibration *cal);
+        int32_t read_raw(uint8_t pack, uint8_t channel);
+        const pack_stats_t *get_stats();
+        bool stack_valid();
         float get_pack_voltage();
         float get_cell_voltage(uint8_t pack, uint8_t cell);
+        float get_cell_recent(uint8_t pack, uint8_t cell, uint8_t window);
         uint8_t over_voltage();
         uint8_t under_voltage();
         uint8_t balancing();
@@ -71,12 +110,22 @@ class MAX14921 {
         ShiftRegister74HC595<1> sr = ShiftRegister74HC595<1>(SRDATA, SRCLOCK, SRLATCH);
         CircularBuffer<float, CIRC_BUFF_LEN> total_pack_voltages;
         float average_pack_voltage;
+        uint8_t cell_settling; // in mseconds
+        uint8_t aout_settling; // in useconds
+        uint8_t filter_len; // number of most recent samples in the moving average
+        uint8_t oversample; // adc reads per sample
+        int32_t scan_buffer[NUM_CELLS]; // oversampled counts from the last scan
+        pack_stats_t stats;
+        uint8_t scanned_packs; // bit per pack fully scanned since boot or wake
+        Calibration *cal;
         pack_data_t pack_data[NUM_PACKS];
         long spiTransfer24(int cs_pin, uint8_t byte1, uint8_t byte2, uint8_t byte3);
+        int32_t read_adc(uint8_t pack);
         void update_cell_average();
         void update_pack_average();
 };
 
 float to_voltage(int adc_val);
+float counts_to_voltage(int32_t counts);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,129 @@
+/*
+Adaptive acquisition policy. Picks the cell scan rate, settling times, adc rate and
+oversampling, and moving average window from pack current and cell dV/dt, and flags cells close to a
+threshold so they can be rechecked on their own before the next full scan.
+*/
+
+#include <Arduino.h>
+#include <MAX14921.h>
+#include <acquisition.h>
+
+AcquisitionPolicy::AcquisitionPolicy() {
+    mode = ACQ_NORMAL;
+    calm_since = 0;
+    for(int i = 0; i < NUM_PACKS; i++) {
+        for(int j = 0; j < NUM_CELLS; j++) {
+            prev_voltages[i][j] = 0;
+        }
+        prev_time[i] = 0;
+        max_dvdt[i] = 0;
+        suspects[i] = 0;
+        suspect_scans[i] = 0;
+    }
+}
+
+//call after each scan of a pack with the latest pack current
+void AcquisitionPolicy::update(uint8_t pack, float current, MAX14921 *max14921) {
+    uint32_t now = millis();
+    float dt = (now - prev_time[pack]) / 1000.0;
+    float dvdt = 0;
+    uint16_t mask = 0;
+
+    for(uint8_t j = 0; j < NUM_CELLS; j++) {
+        //rate from a fixed window, the moving average would jump whenever apply()
+        //changes the filter length and that jump would read as dV/dt
+        float recent = max14921->get_cell_recent(pack, j, DVDT_WINDOW);
+
+        //first scan has nothing to compare against
+        if(prev_time[pack] && dt > 0) {
+            dvdt = max(dvdt, (float)fabs(recent - prev_voltages[pack][j]) / dt);
+        }
+        prev_voltages[pack][j] = recent;
+
+        float cell_voltage = max14921->get_cell_voltage(pack, j);
+        if(fabs(cell_voltage - CELL_THRESH_UPPER) < SUSPECT_MARGIN
+            || fabs(cell_voltage - CELL_THRESH_LOWER) < SUSPECT_MARGIN) {
+            mask |= 1 << j;
+        }
+    }
+
+    prev_time[pack] = now;
+    max_dvdt[pack] = dvdt;
+    suspects[pack] = mask;
+
+    float amps = fabs(current);
+    float pack_dvdt = get_dvdt();
+    acq_mode_t target;
+    if(amps >= ACTIVE_CURRENT || pack_dvdt >= ACTIVE_DVDT) {
+        target = ACQ_ACTIVE;
+    } else if(amps <= REST_CURRENT && pack_dvdt <= REST_DVDT) {
+        target = ACQ_REST;
+    } else {
+        target = ACQ_NORMAL;
+    }
+
+    //speed up straight away, only slow down once it's been quiet for a while
+    if(target >= mode) {
+        mode = target;
+        calm_since = now;
+    } else if(now - calm_since >= (target == ACQ_REST ? REST_HOLD_TIME : ACTIVE_HOLD_TIME)) {
+        mode = target;
+        calm_since = now;
+    }
+}
+
+//pushes the settling times, adc settings and filter window for the current mode
+//to the max14921
+void AcquisitionPolicy::apply(MAX14921 *max14921) {
+    const acq_profile_t *profile = &ACQ_PROFILES[mode];
+    max14921->set_settling(profile->cell_settling, profile->aout_settling);
+    max14921->set_adc(profile->data_rate, profile->oversample);
+
+    if(any_suspects()) {
+        max14921->set_filter_len(min(profile->filter_len, SUSPECT_FILTER_LEN));
+    } else {
+        max14921->set_filter_len(profile->filter_len);
+    }
+}
+
+//cells to read on the next scan of a pack, suspect cells only when a threshold
+//is near with a full scan every FULL_SCAN_EVERY runs so the rest aren't starved
+uint16_t AcquisitionPolicy::next_scan_mask(uint8_t pack) {
+    if(suspects[pack] && suspect_scans[pack] < FULL_SCAN_EVERY) {
+        suspect_scans[pack]++;
+        return suspects[pack];
+    }
+    suspect_scans[pack] = 0;
+    return ALL_CELLS;
+}
+
+//per pack scan period in mseconds
+uint32_t AcquisitionPolicy::scan_period() {
+    uint32_t period = ACQ_PROFILES[mode].scan_period;
+    if(any_suspects()) {
+        period = min(period, SUSPECT_PERIOD);
+    }
+    return period;
+}
+
+acq_mode_t AcquisitionPolicy::get_mode() {
+    return mode;
+}
+
+//fastest moving cell across all packs, in volts per second
+float AcquisitionPolicy::get_dvdt() {
+    float dvdt = 0;
+    for(int i = 0; i < NUM_PACKS; i++) {
+        dvdt = max(dvdt, max_dvdt[i]);
+    }
+    return dvdt;
+}
+
+bool AcquisitionPolicy::any_suspects() {
+    for(int i = 0; i < NUM_PACKS; i++) {
+        if(suspects[i]) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,69 @@
+/*
+Adaptive acquisition policy. Picks the cell scan rate, settling times, adc rate and
+oversampling, and moving average window from pack current and cell dV/dt, and flags cells close to a
+threshold so they can be rechecked on their own before the next full scan.
+*/
+
+#ifndef ACQUISITION_h
+#define ACQUISITION_h
+
+#include <Arduino.h>
+#include <MAX14921.h>
+
+enum acq_mode_t {ACQ_REST, ACQ_NORMAL, ACQ_ACTIVE};
+
+typedef struct {
+    uint32_t scan_period; // in mseconds, per pack
+    uint8_t cell_settling; // in mseconds
+    uint8_t aout_settling; // in useconds
+    uint16_t data_rate; // ads1115 RATE_ setting
+    uint8_t oversample; // adc reads per sample
+    uint8_t filter_len;
+} acq_profile_t;
+
+//indexed by acq_mode_t, normal keeps the original settling and window but reads
+//4x at 860SPS where the original took one read at the ads1115 default 128SPS.
+//a pack scan is the settling plus 15 * oversample conversions, ~1.5ms each at
+//860SPS and ~8ms at 128SPS, so rest ~200ms, normal ~150ms and active ~55ms.
+//periods leave at least 2x that, the scan job also holds the period to twice
+//the measured scan time
+const acq_profile_t ACQ_PROFILES[] = {
+    {2000, 80, 10, RATE_ADS1115_128SPS, 1, CIRC_BUFF_LEN},
+    {400, CELL_SETTLING, AOUT_SETTLING, ADC_DATA_RATE, OVERSAMPLE, CIRC_BUFF_LEN},
+    {150, 30, AOUT_SETTLING, ADC_DATA_RATE, 1, 5},
+};
+
+const float ACTIVE_CURRENT = 50; // in amps
+const float REST_CURRENT = 2; // in amps
+const float ACTIVE_DVDT = 0.02; // in volts per second
+const float REST_DVDT = 0.001; // in volts per second
+const uint32_t REST_HOLD_TIME = 30000; // in mseconds at rest before slowing down
+const uint32_t ACTIVE_HOLD_TIME = 5000; // in mseconds quiet before leaving active
+
+const float SUSPECT_MARGIN = 0.05; // in volts either side of a threshold
+const uint32_t SUSPECT_PERIOD = 200; // in mseconds, per pack, a few cells at normal settings take ~90ms
+const uint8_t SUSPECT_FILTER_LEN = 5;
+const uint8_t FULL_SCAN_EVERY = 4; // full scan after this many suspect only scans
+const uint8_t DVDT_WINDOW = 4; // newest samples averaged for dV/dt, fixed so filter changes don't show up as a step
+
+class AcquisitionPolicy {
+    public:
+        AcquisitionPolicy();
+        void update(uint8_t pack, float current, MAX14921 *max14921);
+        void apply(MAX14921 *max14921);
+        uint16_t next_scan_mask(uint8_t pack);
+        uint32_t scan_period();
+        acq_mode_t get_mode();
+        float get_dvdt();
+    private:
+        acq_mode_t mode;
+        uint32_t calm_since; // in mseconds, last time the load called for the current mode or higher
+        float prev_voltages[NUM_PACKS][NUM_CELLS];
+        uint32_t prev_time[NUM_PACKS];
+        float max_dvdt[NUM_PACKS];
+        uint16_t suspects[NUM_PACKS];
+        uint8_t suspect_scans[NUM_PACKS];
+        bool any_suspects();
+};
+
+#endif
@@ -0,0 +1,84 @@
+/*
+Long term per cell drift, built on the pack stats the max14921 works out each
+scan. Tracks how far each cell sits from the pack mean over time so a cell that
+is slowly falling behind shows up before it trips a threshold.
+*/
+
+#include <Arduino.h>
+#include <MAX14921.h>
+#include <analytics.h>
+
+PackAnalytics::PackAnalytics() {
+    memset(drift, 0, sizeof(drift));
+    weak_pack = 0;
+    weak_cell = 0;
+    updates = 0;
+    last_update = 0;
+}
+
+//call once per full stack scan with the shared stats, single pass over the cells.
+//the ewma weight comes from the time since the last update so the window is the
+//same whether the acquisition policy is scanning fast or slow
+void PackAnalytics::update(const pack_stats_t *stats) {
+    uint32_t now = millis();
+    float alpha = updates ? 1 - exp(-(float)(now - last_update) / DRIFT_TAU) : 1;
+    float weakest = INFINITY;
+    last_update = now;
+
+    for(uint8_t i = 0; i < NUM_PACKS; i++) {
+        for(uint8_t j = 0; j < NUM_CELLS; j++) {
+            //copied cells have no drift of their own
+            if(!(MEASURED_CELLS & (1 << j))) {
+                continue;
+            }
+            cell_drift_t *d = &drift[i][j];
+            float deviation = stats->deviation[i][j];
+
+            //welford, stays stable in float over a long uptime
+            d->samples++;
+            float delta = deviation - d->mean;
+            d->mean += delta / d->samples;
+            d->m2 += delta * (deviation - d->mean);
+
+            d->ewma += alpha * (deviation - d->ewma);
+            if(deviation < d->worst) {
+                d->worst = deviation;
+            }
+
+            //weakest is whoever has sat lowest recently, not just this scan
+            if(d->ewma < weakest) {
+                weakest = d->ewma;
+                weak_pack = i;
+                weak_cell = j;
+            }
+        }
+    }
+
+    drift[stats->min_pack][stats->min_cell].times_min++;
+    updates++;
+}
+
+const cell_drift_t *PackAnalytics::get_drift(uint8_t pack, uint8_t cell) {
+    return &drift[pack][cell];
+}
+
+//spread of a cell's deviation since boot, in volts
+float PackAnalytics::drift_stddev(uint8_t pack, uint8_t cell) {
+    const cell_drift_t *d = &drift[pack][cell];
+    if(d->samples < 2) {
+        return 0;
+    }
+    return sqrt(d->m2 / (d->samples - 1));
+}
+
+uint8_t PackAnalytics::weakest_pack() {
+    return weak_pack;
+}
+
+uint8_t PackAnalytics::weakest_cell() {
+    return weak_cell;
+}
+
+uint32_t PackAnalytics::get_updates() {
+    return updates;
+}
@@ -0,0 +1,41 @@
+/*
+Long term per cell drift, built on the pack stats the max14921 works out each
+scan. Tracks how far each cell sits from the pack mean over time so a cell that
+is slowly falling behind shows up before it trips a threshold.
+*/
+
+#ifndef ANALYTICS_h
+#define ANALYTICS_h
+
+#include <Arduino.h>
+#include <MAX14921.h>
+
+const uint32_t DRIFT_TAU = 300000; // in mseconds, ewma time constant so the scan rate doesn't change the window
+
+typedef struct {
+    uint32_t samples;
+    float mean; // deviation from pack mean since boot, in volts
+    float m2; // running sum of squares for the variance
+    float ewma; // recent deviation from pack mean, in volts
+    float worst; // most negative deviation seen, in volts
+    uint32_t times_min; // scans this cell was the lowest in the stack
+} cell_drift_t;
+
+class PackAnalytics {
+    public:
+        PackAnalytics();
+        void update(const pack_stats_t *stats);
+        const cell_drift_t *get_drift(uint8_t pack, uint8_t cell);
+        float drift_stddev(uint8_t pack, uint8_t cell);
+        uint8_t weakest_pack();
+        uint8_t weakest_cell();
+        uint32_t get_updates();
+    private:
+        cell_drift_t drift[NUM_PACKS][NUM_CELLS];
+        uint8_t weak_pack;
+        uint8_t weak_cell;
+        uint32_t updates;
+        uint32_t last_update; // in mseconds
+};
+
+#endif
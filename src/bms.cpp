@@ -9,11 +9,19 @@
 #include <ESPmDNS.h>
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
-#include <ArduinoJson.h>
 #include <fuel_guage.h>
 #include <MAX14921.h>
 #include <CAN.h>
 #include <CAN_evcc.h>
+#include <scheduler.h>
+#include <power.h>
+#include <acquisition.h>
+#include <calibration.h>
+#include <msg_pool.h>
+#include <heap_stats.h>
+#include <sse.h>
+#include <analytics.h>
+#include <esp_sleep.h>
 // extern "C" {
 // #include "user_interface.h"
 // }
@@ -33,21 +41,68 @@ const uint8_t WIFI_RETRIES = 30;
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
 AsyncEventSource events("/events");
+TelemetryStream sse(&events);
 Adafruit_ADS1115 shunt_adc;
 //instance of max14921 supports two 15 cell packs
 MAX14921 max14921(MAX_CS1, MAX_CS2, MAX_EN1, MAX_EN2);
 bms_status_t bms_status;
+Scheduler scheduler;
+PowerManager power(IGNITION_PIN, CHARGE_PIN);
+AcquisitionPolicy acquisition;
+Calibration calibration;
+PackAnalytics analytics;
 
 const char *ssid = "Ute";
 const char *password = NULL;
 const int SHUNT_RESISTANCE = 125; //in u ohms
-const size_t CAPACITY = JSON_ARRAY_SIZE(NUM_CELLS * 3);
 
 enum state{DRIVING, CHARGING, STANDBY} STATE;
 
 uint8_t current_ignition_state = 0;
 uint8_t current_charge_state = 1; //inverse for off
 
+//latest readings shared between jobs
+float pack_voltage = 0;
+float pack_current = 0;
+uint8_t scan_pack = 0;
+int cell_scan_job = -1;
+uint8_t full_scan_packs = 0; // packs fully scanned since the last analytics update
+uint16_t last_fault_bits = 0;
+bool web_started = false;
+
+void start_web_server();
+
+//calibration requests come in on the web server task and are run by a job so
+//spi and i2c are only ever used from the loop
+enum cal_action_t {CAL_IDLE, CAL_POINT, CAL_SAVE, CAL_RESET};
+volatile cal_action_t cal_action = CAL_IDLE;
+uint8_t cal_pack = 0;
+uint8_t cal_channel = 0;
+float cal_reference = 0;
+int32_t cal_sum = 0;
+uint8_t cal_count = 0;
+char cal_result[96] = "";
+
+//job periods in mseconds, cell scan is per pack so a full stack takes NUM_PACKS runs.
+//starts at the normal profile period, after the first scan the acquisition policy
+//sets it and it is never less than twice the measured scan time
+const uint32_t CELL_SCAN_PERIOD = 400;
+const uint8_t SCAN_PERIOD_MARGIN = 2;
+const uint32_t PACK_VOLTAGE_PERIOD = 250;
+const uint32_t CURRENT_PERIOD = 100;
+const uint32_t BALANCE_PERIOD = 500;
+const uint32_t CAN_STATUS_PERIOD = 500; //evcc wants a status frame at least once a second
+const uint32_t TELEMETRY_PERIOD = 500;
+const uint32_t SSE_PERIOD = 250; //base rate, each event type is decimated from this
+const uint32_t GUAGE_PERIOD = 250;
+const uint32_t GPIO_PERIOD = 250;
+const uint32_t CALIBRATION_PERIOD = 250;
+const uint32_t STATS_PERIOD = 10000;
+
+//light sleep keeps ram and the peripherals so wake is quick, deep sleep saves
+//more but every wake goes back through setup(), minus the web stack on timer wakes
+const power_sleep_t STANDBY_SLEEP = SLEEP_LIGHT;
+
 bool wifi_off() {
     int conn_tries = 0;
 
@@ -69,23 +124,12 @@ bool wifi_off() {
 }
 
 
+//softAP is up as soon as softAP() returns, status() never reads WL_CONNECTED
+//in AP mode so there's nothing to wait for
 bool wifi_on() {
-    int conn_tries = 0;
-
-    WiFi.softAP(ssid, password);
-
-    while ((WiFi.status() != WL_CONNECTED)
-        && (conn_tries++ < WIFI_RETRIES)) {
-        delay(100);
-        #ifdef DEBUG
-            Serial.print('.');
-        #endif
-    }
-    if (WiFi.status() == WL_CONNECTED) {
-        return true;
-    } else {
-        return false;
-    }
+    bool started = WiFi.softAP(ssid, password);
+    start_web_server();
+    return started;
 }
 
 //polls ignition GPIO every 250ms, changes state from charging to driving 
@@ -160,38 +204,33 @@ float measure_current() {
 }
 
 
+//json array of cell voltages then current and pack voltage, built in a pool
+//block rather than a json document and stack buffers to keep off the heap
 void send_data_ws() {
-    StaticJsonDocument<CAPACITY> doc;
-    JsonArray cell_array = doc.to<JsonArray>();
-
-    //populate array with cell voltages
-    for(int j = 0; j < NUM_PACKS; j++) {
-        for(int i = 0; i < NUM_CELLS; i++) {
+    char *buff = msg_pool.alloc();
+    if (!buff) {
+        return;
+    }
 
-            float cell_voltage = max14921.get_cell_voltage(j, i);
-            char cell_voltage_buff[10];
-            sprintf(cell_voltage_buff, "%.2f", cell_voltage);
-            cell_array.add(cell_voltage_buff);
+    size_t len = 0;
+    buff[len++] = '[';
+    //snprintf returns the untruncated length, so stop once the block is full
+    for(int j = 0; j < NUM_PACKS && len < MSG_BLOCK_SIZE; j++) {
+        for(int i = 0; i < NUM_CELLS && len < MSG_BLOCK_SIZE; i++) {
+            len += snprintf(buff + len, MSG_BLOCK_SIZE - len, "\"%.2f\",", max14921.get_cell_voltage(j, i));
         }
     }
+    if (len < MSG_BLOCK_SIZE) {
+        len += snprintf(buff + len, MSG_BLOCK_SIZE - len, "\"%.2f\",\"%.2f\"]", pack_current, pack_voltage);
+    }
 
-    float current = measure_current();
-    char current_buff[10];
-    sprintf(current_buff, "%.2f", current);
-    cell_array.add(current_buff);
-
-    float pack_voltage = max14921.get_pack_voltage();
-    char pack_voltage_buff[10];
-    sprintf(pack_voltage_buff, "%.2f", pack_voltage);
-    cell_array.add(pack_voltage_buff);
-    
-    //don't actually need 300 chars
-    char buff[300];
-    serializeJson(doc, buff);
-    
-    //send char array over websockets
-    ws.textAll(buff);
+    //the web server allocates a message per send, so only send to actual clients
+    if (len < MSG_BLOCK_SIZE && ws.count()) {
+        ws.textAll(buff, len);
+    }
     Serial.println(buff);
+
+    msg_pool.release(buff);
 }
 
 
@@ -221,32 +260,253 @@ void webSocketEvent(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsE
 }
 
 
-void setup() {
-    Serial.begin(115200); 
-    SPIFFS.begin();
-    SPI.begin();//sets cs to output and pull high
-    max14921.begin();
-    shunt_adc.begin(SHUNT_ADC_ADDR);
-    
-    if (!CAN.begin(CAN_RATE)) {
-        #ifdef DEBUG
-        Serial.println("Starting CAN failed!");
-        #endif
-        while (1);
+bool acquiring() {
+    return STATE == DRIVING || STATE == CHARGING;
+}
+
+//put max14921 into sample phase, give caps some time to settle at cell voltage
+//and read one pack per run. rate, settling and filter window follow the load
+void job_cell_scan() {
+    if (!acquiring()) {
+        return;
+    }
+    uint32_t start = millis();
+    uint16_t cell_mask = acquisition.next_scan_mask(scan_pack);
+    max14921.record_cell_voltages(scan_pack, cell_mask);
+    uint32_t scan_time = millis() - start;
+
+    //long term drift takes one sample per full stack scan, suspect only scans
+    //and the pack not just read would otherwise be counted again. stats from a
+    //half scanned stack have the other pack at 0V, so it also waits for that
+    if (cell_mask == ALL_CELLS) {
+        full_scan_packs |= 1 << scan_pack;
+    }
+    if (full_scan_packs == (1 << NUM_PACKS) - 1 && max14921.stack_valid()) {
+        analytics.update(max14921.get_stats());
+        full_scan_packs = 0;
     }
 
-    CAN.setPins(CAN_RX, CAN_TX); //rx tx
-    pinMode(CHARGE_PIN, INPUT);
-    pinMode(IGNITION_PIN, INPUT);
+    acquisition.update(scan_pack, pack_current, &max14921);
+    acquisition.apply(&max14921);
+    //period the hardware can actually meet, so a miss means something
+    scheduler.set_period(cell_scan_job, max(acquisition.scan_period(), scan_time * SCAN_PERIOD_MARGIN));
 
-    //interrupts on pins for state changes
-    //attachInterrupt(IGNITION_PIN, ignition_interrupt, CHANGE);
-    //attachInterrupt(CHARGE_PIN, charge_interrupt, CHANGE);
+    scan_pack = (scan_pack + 1) % NUM_PACKS;
+    power.first_scan_done();
+}
 
-    ledcSetup(CHANNEL, FREQ, RESOLUTION);
-    ledcAttachPin(GUAGE_PIN, CHANNEL);
+void job_pack_voltage() {
+    if (acquiring()) {
+        pack_voltage = max14921.get_pack_voltage();
+    }
+}
 
-    WiFi.softAP(ssid, password);
+void job_current() {
+    if (acquiring()) {
+        pack_current = measure_current();
+    }
+}
+
+//balance cells to avoid individual cell overcharging
+void job_balancing() {
+    if (STATE == CHARGING) {
+        max14921.balance_cells();
+    }
+}
+
+//fault checks and status frame to the evcc, held off until both packs have
+//been scanned so unscanned cells at 0V don't get reported as LVC
+void job_can_status() {
+    if (STATE == CHARGING && max14921.stack_valid()) {
+        set_bms_status(&bms_status, &max14921);
+        send_can_evcc(&bms_status);
+    }
+}
+
+//send bms data to client through websocket
+void job_telemetry() {
+    if (STATE == DRIVING) {
+        send_data_ws();
+    }
+    //frees clients that dropped without closing, they otherwise hold heap forever
+    ws.cleanupClients();
+}
+
+//sse stream, cells and soc on their decimated rate, faults also straight away
+//whenever a flag changes
+void job_sse() {
+    if (!acquiring() || !max14921.stack_valid()) {
+        return;
+    }
+    char *buff = msg_pool.alloc();
+    if (!buff) {
+        return;
+    }
+    sse.tick();
+
+    if (sse.due(SSE_CELLS)) {
+        size_t len = snprintf(buff, SSE_MSG_LEN, "{\"packs\":[");
+        //stop early rather than run past the end if the table ever outgrows it
+        for(int j = 0; j < NUM_PACKS && len < SSE_MSG_LEN; j++) {
+            len += snprintf(buff + len, SSE_MSG_LEN - len, j ? ",[" : "[");
+            for(int i = 0; i < NUM_CELLS && len < SSE_MSG_LEN; i++) {
+                len += snprintf(buff + len, SSE_MSG_LEN - len, i ? ",%.3f" : "%.3f", max14921.get_cell_voltage(j, i));
+            }
+            if (len < SSE_MSG_LEN) {
+                len += snprintf(buff + len, SSE_MSG_LEN - len, "]");
+            }
+        }
+        //stack stats and the weakest cell by long term drift
+        const pack_stats_t *stats = max14921.get_stats();
+        if (len < SSE_MSG_LEN) {
+            len += snprintf(buff + len, SSE_MSG_LEN - len,
+                "],\"min\":[%.3f,%u,%u],\"max\":[%.3f,%u,%u],\"spread\":%.3f,\"mean\":%.3f,\"stddev\":%.4f,\"weakest\":[%u,%u]}",
+                stats->min, stats->min_pack, stats->min_cell, stats->max, stats->max_pack, stats->max_cell,
+                stats->spread, stats->mean, stats->stddev, analytics.weakest_pack(), analytics.weakest_cell());
+        }
+        if (len < SSE_MSG_LEN) {
+            sse.publish(SSE_CELLS, buff);
+        }
+    }
+
+    bms_status_t faults = {};
+    set_bms_status(&faults, &max14921);
+    uint16_t fault_bits = faults.bBMSStatusFlags | (faults.bBMSFault << 8);
+    if (sse.due(SSE_FAULTS) || fault_bits != last_fault_bits) {
+        snprintf(buff, SSE_MSG_LEN, "{\"hvc\":%d,\"lvc\":%d,\"bvc\":%d,\"overtemp\":%d}",
+            !!(faults.bBMSStatusFlags & BMS_STATUS_CELL_HVC_FLAG),
+            !!(faults.bBMSStatusFlags & BMS_STATUS_CELL_LVC_FLAG),
+            !!(faults.bBMSStatusFlags & BMS_STATUS_CELL_BVC_FLAG),
+            !!(faults.bBMSFault & BMS_FAULT_OVERTEMP_FLAG));
+        sse.publish(SSE_FAULTS, buff);
+        last_fault_bits = fault_bits;
+    }
+
+    if (sse.due(SSE_SOC)) {
+        snprintf(buff, SSE_MSG_LEN, "{\"soc\":%d,\"pack_voltage\":%.2f,\"current\":%.2f}",
+            voltage_to_percentage(pack_voltage), pack_voltage, pack_current);
+        sse.publish(SSE_SOC, buff);
+    }
+
+    msg_pool.release(buff);
+}
+
+void job_guage() {
+    if (STATE == DRIVING && max14921.stack_valid()) {
+        int battery_percent = voltage_to_percentage(pack_voltage);
+        bool undervolt = max14921.under_voltage();
+        //set battery guage to 0 if a single cell is under the lower threshold
+        set_battery_guage(battery_percent * !undervolt);
+    }
+}
+
+void job_gpio() {
+    poll_ignition();
+    poll_charge();
+}
+
+void job_calibration() {
+    switch(cal_action) {
+        case CAL_POINT: {
+            //bleed resistors pull the reading down, a gain fitted then would be wrong
+            if (max14921.balancing()) {
+                snprintf(cal_result, sizeof(cal_result), "refused: cells balancing");
+                break;
+            }
+
+            //one reading per run so a capture doesn't hold up the other jobs.
+            //max14921 is asleep in standby, wake it just for the reading
+            if (STATE == STANDBY) {
+                max14921.wake();
+            }
+            cal_sum += max14921.read_raw(cal_pack, cal_channel);
+            if (STATE == STANDBY) {
+                max14921.sleep();
+            }
+            if (++cal_count < CAL_SAMPLES) {
+                return;
+            }
+
+            int32_t raw = cal_sum / CAL_SAMPLES;
+            bool ok = calibration.add_point(cal_pack, cal_channel, raw, cal_reference);
+            const cal_coeff_t *coeff = calibration.get(cal_pack, cal_channel);
+            snprintf(cal_result, sizeof(cal_result), "%s: pack %u channel %u raw %d gain %.5f offset %d",
+                ok ? "ok" : "rejected", cal_pack, cal_channel, (int)raw,
+                (float)coeff->gain / UNITY_GAIN, (int)coeff->offset);
+        } break;
+        case CAL_SAVE: {
+            bool ok = calibration.save();
+            snprintf(cal_result, sizeof(cal_result), ok ? "saved" : "save failed");
+        } break;
+        case CAL_RESET: {
+            calibration.reset();
+            snprintf(cal_result, sizeof(cal_result), "reset to unity, save to clear stored table");
+        } break;
+        case CAL_IDLE:
+            return;
+    }
+    Serial.println(cal_result);
+    cal_action = CAL_IDLE;
+}
+
+void job_stats() {
+    scheduler.print_stats();
+    power.print_stats();
+    print_heap_stats();
+
+    const pack_stats_t *stats = max14921.get_stats();
+    uint8_t weak_pack = analytics.weakest_pack();
+    uint8_t weak_cell = analytics.weakest_cell();
+    const cell_drift_t *drift = analytics.get_drift(weak_pack, weak_cell);
+    pool_printf("cells: min %.3fV (%u/%u), max %.3fV (%u/%u), spread %.3fV, stddev %.4fV\n",
+        stats->min, stats->min_pack, stats->min_cell, stats->max, stats->max_pack, stats->max_cell,
+        stats->spread, stats->stddev);
+    pool_printf("weakest %u/%u: drift %.4fV (sd %.4fV, worst %.4fV), lowest in %u of %u stack scans\n",
+        weak_pack, weak_cell, drift->ewma, analytics.drift_stddev(weak_pack, weak_cell), drift->worst,
+        drift->times_min, analytics.get_updates());
+    pool_printf("acquisition mode: %d, max dv/dt: %.4fV/s\n", acquisition.get_mode(), acquisition.get_dvdt());
+}
+
+//periodic scan while parked, max14921 goes straight back to low power after
+void health_scan() {
+    max14921.wake();
+    max14921.record_cell_voltages();
+    analytics.update(max14921.get_stats());
+    power.first_scan_done();
+    if (max14921.under_voltage()) {
+        Serial.println("Standby health scan: cell under threshold voltage");
+    }
+    max14921.sleep();
+}
+
+//ads1115 is single shot so it powers down between conversions by itself and
+//keeps its config through light sleep, only the can controller needs putting down
+void standby_sleep() {
+    if (power.scan_pending()) {
+        health_scan();
+    }
+    if (STATE != STANDBY || !power.can_sleep()) {
+        return;
+    }
+    if (WiFi.getMode() != WIFI_OFF) {
+        wifi_off();
+    }
+
+    CAN.sleep();
+    power.sleep();
+    CAN.wakeup();
+
+    //don't count the time asleep as missed deadlines
+    scheduler.resync();
+}
+
+//mdns, websocket, sse and http handlers. only done once, either at boot or the
+//first time wifi comes on after a deep sleep timer wake
+void start_web_server() {
+    if (web_started) {
+        return;
+    }
+    web_started = true;
 
     IPAddress IP = WiFi.softAPIP();
     #ifdef DEBUG
@@ -263,6 +523,7 @@ void setup() {
     MDNS.addService("http", "tcp", 80);
     ws.onEvent(webSocketEvent);
     server.addHandler(&ws);
+    sse.begin();
     server.addHandler(&events);
 
     server.serveStatic("/", SPIFFS, "/").setDefaultFile("bms_data.html");
@@ -280,54 +541,133 @@ void setup() {
         request->send(SPIFFS, "/jquery.mobile-1.4.5.min.js", "text/javascript");
     });
 
+    //handlers match on prefix so the longer calibrate urls go first
+    server.on("/calibrate/save", HTTP_GET, [](AsyncWebServerRequest *request){
+        if (cal_action != CAL_IDLE) {
+            request->send(409, "text/plain", "busy");
+            return;
+        }
+        cal_action = CAL_SAVE;
+        request->send(202, "text/plain", "queued");
+    });
+
+    server.on("/calibrate/reset", HTTP_GET, [](AsyncWebServerRequest *request){
+        if (cal_action != CAL_IDLE) {
+            request->send(409, "text/plain", "busy");
+            return;
+        }
+        cal_action = CAL_RESET;
+        request->send(202, "text/plain", "queued");
+    });
+
+    server.on("/calibrate/status", HTTP_GET, [](AsyncWebServerRequest *request){
+        request->send(200, "text/plain", cal_action == CAL_IDLE ? cal_result : "busy");
+    });
+
+    //cell is 0-14, or 15 for the pack voltage with ref as the whole pack voltage
+    server.on("/calibrate", HTTP_GET, [](AsyncWebServerRequest *request){
+        if (cal_action != CAL_IDLE) {
+            request->send(409, "text/plain", "busy");
+            return;
+        }
+        if (!request->hasParam("pack") || !request->hasParam("cell") || !request->hasParam("ref")) {
+            request->send(400, "text/plain", "need pack, cell and ref");
+            return;
+        }
+        int pack = request->getParam("pack")->value().toInt();
+        int cell = request->getParam("cell")->value().toInt();
+        float ref = request->getParam("ref")->value().toFloat();
+        if (pack < 0 || pack >= NUM_PACKS || cell < 0 || cell >= CAL_CHANNELS || ref <= 0) {
+            request->send(400, "text/plain", "out of range");
+            return;
+        }
+        if (max14921.balancing()) {
+            request->send(409, "text/plain", "cells balancing");
+            return;
+        }
+        cal_sum = 0;
+        cal_count = 0;
+        cal_pack = pack;
+        cal_channel = cell;
+        cal_reference = ref;
+        cal_action = CAL_POINT;
+        request->send(202, "text/plain", "queued");
+    });
+
     server.onNotFound([](AsyncWebServerRequest *request){
         request->send(404);
     });
 
-    server.begin(); 
+    server.begin();
+}
+
+
+void setup_jobs() {
+    //lower number is higher priority, fault reporting and state changes come first
+    scheduler.add_job("can_status", job_can_status, CAN_STATUS_PERIOD, 0);
+    scheduler.add_job("gpio", job_gpio, GPIO_PERIOD, 1);
+    scheduler.add_job("current", job_current, CURRENT_PERIOD, 2);
+    scheduler.add_job("pack_volt", job_pack_voltage, PACK_VOLTAGE_PERIOD, 3);
+    cell_scan_job = scheduler.add_job("cell_scan", job_cell_scan, CELL_SCAN_PERIOD, 4);
+    scheduler.add_job("balancing", job_balancing, BALANCE_PERIOD, 5);
+    scheduler.add_job("guage", job_guage, GUAGE_PERIOD, 6);
+    scheduler.add_job("telemetry", job_telemetry, TELEMETRY_PERIOD, 7);
+    scheduler.add_job("sse", job_sse, SSE_PERIOD, 7);
+    scheduler.add_job("calibrate", job_calibration, CALIBRATION_PERIOD, 8);
+    #ifdef DEBUG
+    scheduler.add_job("stats", job_stats, STATS_PERIOD, 9);
+    #endif
+    scheduler.begin();
+}
+
+
+void setup() {
+    Serial.begin(115200); 
+    SPIFFS.begin();
+    SPI.begin();//sets cs to output and pull high
+    max14921.begin();
+    calibration.begin();
+    max14921.set_calibration(&calibration);
+    shunt_adc.begin(SHUNT_ADC_ADDR);
+    
+    if (!CAN.begin(CAN_RATE)) {
+        #ifdef DEBUG
+        Serial.println("Starting CAN failed!");
+        #endif
+        while (1);
+    }
+
+    CAN.setPins(CAN_RX, CAN_TX); //rx tx
+    pinMode(CHARGE_PIN, INPUT);
+    pinMode(IGNITION_PIN, INPUT);
+
+    //interrupts on pins for state changes
+    //attachInterrupt(IGNITION_PIN, ignition_interrupt, CHANGE);
+    //attachInterrupt(CHARGE_PIN, charge_interrupt, CHANGE);
+
+    ledcSetup(CHANNEL, FREQ, RESOLUTION);
+    ledcAttachPin(GUAGE_PIN, CHANNEL);
+
+    //a deep sleep timer wake is only a health scan, wifi_on() brings the web
+    //server up later if the ignition or charger comes on
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER) {
+        WiFi.softAP(ssid, password);
+        start_web_server();
+    }
 
     //STATE = CHARGING;
     //STATE = DRIVING;
     STATE = STANDBY;
     max14921.sleep();
+
+    power.begin(STANDBY_SLEEP);
+
+    setup_jobs();
 }
 
-//put max14921 into smaple phase
-//give caps some time to settle at cell voltage, 500ms is definitely too much
-//read voltages and send to client over websockets
 void loop() {
-    //need a loop output going to evcc that checks for cell under/overvoltage
-    float pack_voltage = 0;
-
-    if (STATE == DRIVING || STATE == CHARGING) {
-        pack_voltage = max14921.get_pack_voltage();
-        max14921.record_cell_voltages();
-        //send bms data to client through websocket
+    if (STATE == STANDBY) {
+        standby_sleep();
     }
-    
-    //is there a way to combine if above ^ with switch below??
-    switch(STATE) {
-        case DRIVING: {
-            int battery_percent = voltage_to_percentage(pack_voltage);
-            bool undervolt = max14921.under_voltage();
-            //set battery guage to 0 if a single cell is under the lower threshold
-            set_battery_guage(battery_percent * !undervolt);
-            send_data_ws();
-        } break;
-        case CHARGING: {
-            //balance cells to avoid individual cell overcharging
-            max14921.balance_cells();
-            set_bms_status(&bms_status, &max14921);
-            //send can message at least once a second
-            //send_can_evcc(&bms_status);
-        } break;
-        case STANDBY: {
-            //low power mode
-        } break;
-    }
-
-    poll_ignition();
-    poll_charge();
-
-    delay(250);
-}
\ No newline at end of file
+    scheduler.run();
+}
@@ -0,0 +1,107 @@
+/*
+Per pack, per channel offset and gain calibration for the max14921 aout readings.
+Coefficients are fixed point and stored in nvs. Readings are oversampled sums of
+ADC counts and get corrected in one integer pass before being turned into volts.
+*/
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <MAX14921.h>
+#include <calibration.h>
+
+Calibration::Calibration() {
+    reset();
+}
+
+//loads the stored table, falls back to unity if nothing valid has been saved
+void Calibration::begin() {
+    reset();
+
+    prefs.begin("bms_cal", true);
+    if(prefs.getUChar("version", 0) == CAL_VERSION
+        && prefs.getBytesLength("coeffs") == sizeof(coeffs)) {
+        prefs.getBytes("coeffs", coeffs, sizeof(coeffs));
+    }
+    prefs.end();
+}
+
+bool Calibration::save() {
+    prefs.begin("bms_cal", false);
+    prefs.putUChar("version", CAL_VERSION);
+    size_t written = prefs.putBytes("coeffs", coeffs, sizeof(coeffs));
+    prefs.end();
+
+    return written == sizeof(coeffs);
+}
+
+//back to unity in ram, call save() to clear the stored table too
+void Calibration::reset() {
+    for(int i = 0; i < NUM_PACKS; i++) {
+        for(int j = 0; j < CAL_CHANNELS; j++) {
+            coeffs[i][j].offset = 0;
+            coeffs[i][j].gain = UNITY_GAIN;
+            have_point[i][j] = false;
+        }
+    }
+}
+
+int32_t Calibration::correct(uint8_t pack, uint8_t channel, int32_t raw) {
+    const cal_coeff_t *c = &coeffs[pack][channel];
+    return (int32_t)(((int64_t)(raw - c->offset) * c->gain) >> GAIN_SHIFT);
+}
+
+//corrects a pack's scan buffer in place, only the cells in cell_mask were read
+void Calibration::correct_all(uint8_t pack, int32_t *counts, uint16_t cell_mask) {
+    const cal_coeff_t *c = coeffs[pack];
+    for(uint8_t j = 0; j < NUM_CELLS; j++) {
+        if(cell_mask & (1 << j)) {
+            counts[j] = (int32_t)(((int64_t)(counts[j] - c[j].offset) * c[j].gain) >> GAIN_SHIFT);
+        }
+    }
+}
+
+//takes a raw reading against a reference voltage measured with a meter. the first
+//point fits gain only, a second point far enough from the first fits gain and
+//offset. reference is the cell voltage, or the whole pack for CAL_PACK_CHANNEL
+bool Calibration::add_point(uint8_t pack, uint8_t channel, int32_t raw, float reference) {
+    if(pack >= NUM_PACKS || channel >= CAL_CHANNELS || raw <= 0 || reference <= 0) {
+        return false;
+    }
+
+    float scale = (channel == CAL_PACK_CHANNEL) ? PACK_DIVIDER : 1;
+    int32_t ref = lround(reference / scale * (1 << OVERSAMPLE_BITS) / (ADC_CONST));
+    int32_t min_span = lround(CAL_MIN_SPAN / scale * (1 << OVERSAMPLE_BITS) / (ADC_CONST));
+
+    cal_point_t *first = &first_point[pack][channel];
+    bool two_point = have_point[pack][channel]
+        && abs(ref - first->ref) >= min_span
+        && raw != first->raw;
+
+    cal_coeff_t fit;
+    if(two_point) {
+        fit.gain = (int64_t)(ref - first->ref) * UNITY_GAIN / (raw - first->raw);
+        fit.offset = raw - (int64_t)ref * UNITY_GAIN / fit.gain;
+    } else {
+        fit.gain = (int64_t)ref * UNITY_GAIN / raw;
+        fit.offset = 0;
+    }
+
+    if(abs(fit.gain - UNITY_GAIN) > CAL_MAX_GAIN_ERROR * UNITY_GAIN
+        || abs(fit.offset) > CAL_MAX_OFFSET) {
+        return false;
+    }
+
+    coeffs[pack][channel] = fit;
+    if(two_point) {
+        have_point[pack][channel] = false;
+    } else {
+        first->raw = raw;
+        first->ref = ref;
+        have_point[pack][channel] = true;
+    }
+    return true;
+}
+
+const cal_coeff_t *Calibration::get(uint8_t pack, uint8_t channel) {
+    return &coeffs[pack][channel];
+}
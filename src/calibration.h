@@ -0,0 +1,52 @@
+/*
+Per pack, per channel offset and gain calibration for the max14921 aout readings.
+Coefficients are fixed point and stored in nvs. Readings are oversampled sums of
+ADC counts and get corrected in one integer pass before being turned into volts.
+*/
+
+#ifndef CALIBRATION_h
+#define CALIBRATION_h
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <MAX14921.h>
+
+const uint8_t CAL_PACK_CHANNEL = NUM_CELLS; // pack voltage divider, after the cells
+const uint8_t CAL_CHANNELS = NUM_CELLS + 1;
+const uint8_t GAIN_SHIFT = 16;
+const int32_t UNITY_GAIN = (int32_t)1 << GAIN_SHIFT;
+
+const float CAL_MAX_GAIN_ERROR = 0.1; // reject fits more than 10% out
+const int32_t CAL_MAX_OFFSET = 1000; // in oversampled counts, about 94mV
+const float CAL_MIN_SPAN = 0.2; // in volts between two reference points
+const uint8_t CAL_SAMPLES = 8; // readings averaged for a calibration point
+const uint8_t CAL_VERSION = 2;
+
+typedef struct {
+    int32_t offset; // in oversampled counts
+    int32_t gain; // UNITY_GAIN is 1.0
+} cal_coeff_t;
+
+typedef struct {
+    int32_t raw;
+    int32_t ref; // in oversampled counts
+} cal_point_t;
+
+class Calibration {
+    public:
+        Calibration();
+        void begin();
+        bool save();
+        void reset();
+        int32_t correct(uint8_t pack, uint8_t channel, int32_t raw);
+        void correct_all(uint8_t pack, int32_t *counts, uint16_t cell_mask);
+        bool add_point(uint8_t pack, uint8_t channel, int32_t raw, float reference);
+        const cal_coeff_t *get(uint8_t pack, uint8_t channel);
+    private:
+        cal_coeff_t coeffs[NUM_PACKS][CAL_CHANNELS];
+        cal_point_t first_point[NUM_PACKS][CAL_CHANNELS];
+        bool have_point[NUM_PACKS][CAL_CHANNELS];
+        Preferences prefs;
+};
+
+#endif
@@ -0,0 +1,63 @@
+/*
+Heap allocation counter and fragmentation report. malloc, calloc and realloc are
+wrapped at link time (see build_flags) so every allocation made through them,
+including new and the async web server, gets counted.
+*/
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <heap_stats.h>
+#include <msg_pool.h>
+
+static uint32_t alloc_count = 0;
+static uint32_t last_count = 0;
+static uint32_t last_time = 0;
+static uint32_t min_largest = 0xFFFFFFFF;
+
+extern "C" {
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t n, size_t size);
+    void *__real_realloc(void *ptr, size_t size);
+
+    void *__wrap_malloc(size_t size) {
+        __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+        return __real_malloc(size);
+    }
+
+    void *__wrap_calloc(size_t n, size_t size) {
+        __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+        return __real_calloc(n, size);
+    }
+
+    void *__wrap_realloc(void *ptr, size_t size) {
+        __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+        return __real_realloc(ptr, size);
+    }
+}
+
+void update_heap_stats(heap_stats_t *stats) {
+    uint32_t now = millis();
+    uint32_t count = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+
+    stats->allocs = count;
+    stats->alloc_rate = (now != last_time) ? (count - last_count) * 1000.0 / (now - last_time) : 0;
+    stats->free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    stats->min_free_heap = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    stats->largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    if (stats->largest_block < min_largest) {
+        min_largest = stats->largest_block;
+    }
+    stats->min_largest_block = min_largest;
+
+    last_count = count;
+    last_time = now;
+}
+
+void print_heap_stats() {
+    heap_stats_t stats;
+    update_heap_stats(&stats);
+    pool_printf("heap: %.1f allocs/s (%u total), free %u (min %u), largest block %u (min %u), msg pool %u/%u (peak %u, dropped %u)\n",
+        stats.alloc_rate, stats.allocs, stats.free_heap, stats.min_free_heap,
+        stats.largest_block, stats.min_largest_block,
+        msg_pool.in_use(), MSG_BLOCKS, msg_pool.high_water(), msg_pool.failures());
+}
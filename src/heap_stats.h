@@ -0,0 +1,24 @@
+/*
+Heap allocation counter and fragmentation report. malloc, calloc and realloc are
+wrapped at link time (see build_flags) so every allocation made through them,
+including new and the async web server, gets counted.
+*/
+
+#ifndef HEAP_STATS_h
+#define HEAP_STATS_h
+
+#include <Arduino.h>
+
+typedef struct {
+    uint32_t allocs; // total since boot
+    float alloc_rate; // per second since the last report
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    uint32_t largest_block;
+    uint32_t min_largest_block; // lowest seen, grows worse if the heap fragments
+} heap_stats_t;
+
+void update_heap_stats(heap_stats_t *stats);
+void print_heap_stats();
+
+#endif
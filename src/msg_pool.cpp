@@ -0,0 +1,81 @@
+/*
+Fixed pool of message buffers for telemetry, can and log messages. Blocks are
+statically allocated so the hot paths never touch the heap, which otherwise
+fragments over a long drive.
+*/
+
+#include <Arduino.h>
+#include <msg_pool.h>
+
+MsgPool msg_pool;
+
+MsgPool::MsgPool() {
+    free_mask = ((uint32_t)1 << MSG_BLOCKS) - 1;
+    used = 0;
+    max_used = 0;
+    failed = 0;
+    mux = portMUX_INITIALIZER_UNLOCKED;
+}
+
+//returns NULL when every block is in use, callers drop the message
+char *MsgPool::alloc() {
+    char *block = NULL;
+
+    //web server callbacks run on the async tcp task so guard against the loop
+    portENTER_CRITICAL(&mux);
+    if (free_mask) {
+        int i = __builtin_ctz(free_mask);
+        free_mask &= ~((uint32_t)1 << i);
+        block = blocks[i];
+        if (++used > max_used) {
+            max_used = used;
+        }
+    } else {
+        failed++;
+    }
+    portEXIT_CRITICAL(&mux);
+
+    return block;
+}
+
+void MsgPool::release(char *block) {
+    if (!block) {
+        return;
+    }
+    int i = (block - blocks[0]) / MSG_BLOCK_SIZE;
+
+    portENTER_CRITICAL(&mux);
+    free_mask |= (uint32_t)1 << i;
+    used--;
+    portEXIT_CRITICAL(&mux);
+}
+
+uint8_t MsgPool::in_use() {
+    return used;
+}
+
+uint8_t MsgPool::high_water() {
+    return max_used;
+}
+
+uint32_t MsgPool::failures() {
+    return failed;
+}
+
+
+void pool_printf(const char *format, ...) {
+    char *buff = msg_pool.alloc();
+    if (!buff) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buff, MSG_BLOCK_SIZE, format, args);
+    va_end(args);
+
+    if (len > 0) {
+        Serial.write((uint8_t *)buff, min((size_t)len, MSG_BLOCK_SIZE - 1));
+    }
+    msg_pool.release(buff);
+}
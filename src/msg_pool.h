@@ -0,0 +1,37 @@
+/*
+Fixed pool of message buffers for telemetry, can and log messages. Blocks are
+statically allocated so the hot paths never touch the heap, which otherwise
+fragments over a long drive.
+*/
+
+#ifndef MSG_POOL_h
+#define MSG_POOL_h
+
+#include <Arduino.h>
+
+const size_t MSG_BLOCK_SIZE = 512;
+const uint8_t MSG_BLOCKS = 8; // at most 31, free blocks are tracked in a bitmask
+
+class MsgPool {
+    public:
+        MsgPool();
+        char *alloc();
+        void release(char *block);
+        uint8_t in_use();
+        uint8_t high_water();
+        uint32_t failures();
+    private:
+        char blocks[MSG_BLOCKS][MSG_BLOCK_SIZE];
+        uint32_t free_mask;
+        uint8_t used;
+        uint8_t max_used;
+        uint32_t failed;
+        portMUX_TYPE mux;
+};
+
+extern MsgPool msg_pool;
+
+//printf to serial through a pool block, Serial.printf mallocs past 64 chars
+void pool_printf(const char *format, ...);
+
+#endif
@@ -0,0 +1,155 @@
+/*
+Power manager for STANDBY. Puts the esp32 into light or deep sleep with wakeup
+from the ignition and charge pins and a slow timer for periodic health scans.
+Keeps sleep residency and wake to first scan latency so the savings can be checked.
+*/
+
+#include <Arduino.h>
+#include <sys/time.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <power.h>
+#include <msg_pool.h>
+
+//kept in rtc memory so the totals survive deep sleep
+RTC_DATA_ATTR static uint64_t power_on_time = 0;
+RTC_DATA_ATTR static uint64_t sleep_start = 0;
+RTC_DATA_ATTR static uint64_t total_sleep = 0;
+RTC_DATA_ATTR static uint32_t gpio_wakes = 0;
+RTC_DATA_ATTR static uint32_t timer_wakes = 0;
+
+//rtc backed system time keeps counting through both sleep modes, unlike millis()
+//which restarts after deep sleep
+static uint64_t rtc_time_us() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static wake_cause_t to_wake_cause(esp_sleep_wakeup_cause_t cause) {
+    switch(cause) {
+        case ESP_SLEEP_WAKEUP_GPIO:
+        case ESP_SLEEP_WAKEUP_EXT0:
+        case ESP_SLEEP_WAKEUP_EXT1:
+            return WAKE_GPIO;
+        case ESP_SLEEP_WAKEUP_TIMER:
+            return WAKE_TIMER;
+        default:
+            return WAKE_NONE;
+    }
+}
+
+
+PowerManager::PowerManager(uint8_t ignition_pin, uint8_t charge_pin) {
+    this->ignition_pin = ignition_pin;
+    this->charge_pin = charge_pin;
+    mode = SLEEP_LIGHT;
+    last_wake = 0;
+    wake_start = 0;
+    latency_pending = false;
+    health_scan_pending = false;
+    last_latency = 0;
+    max_latency = 0;
+}
+
+void PowerManager::begin(power_sleep_t mode) {
+    this->mode = mode;
+
+    wake_cause_t cause = to_wake_cause(esp_sleep_get_wakeup_cause());
+    if (cause == WAKE_NONE) {
+        //cold boot, nothing in rtc memory is valid yet
+        power_on_time = rtc_time_us();
+        total_sleep = 0;
+        gpio_wakes = 0;
+        timer_wakes = 0;
+    } else {
+        //back from deep sleep, latency is measured from boot so it includes setup()
+        record_wake(cause, rtc_time_us() - sleep_start);
+        wake_start = 0;
+    }
+}
+
+void PowerManager::record_wake(wake_cause_t cause, uint64_t slept) {
+    total_sleep += slept;
+    last_wake = millis();
+    wake_start = micros();
+    latency_pending = true;
+
+    if (cause == WAKE_TIMER) {
+        timer_wakes++;
+        health_scan_pending = true;
+    } else if (cause == WAKE_GPIO) {
+        gpio_wakes++;
+    }
+}
+
+//only sleep with ignition off and charger unplugged, otherwise the level
+//triggered wakeup fires straight away
+bool PowerManager::can_sleep() {
+    return digitalRead(ignition_pin) == LOW
+        && digitalRead(charge_pin) == HIGH
+        && !health_scan_pending
+        && millis() - last_wake >= MIN_AWAKE_TIME;
+}
+
+//returns once woken in light sleep, never returns in deep sleep
+wake_cause_t PowerManager::sleep() {
+    esp_sleep_enable_timer_wakeup((uint64_t)HEALTH_SCAN_INTERVAL * 1000000);
+    Serial.flush();
+
+    if (mode == SLEEP_DEEP) {
+        //only rtc gpios can wake from deep sleep, ignition is active high and
+        //charge is active low so they need one ext source each
+        esp_sleep_enable_ext0_wakeup((gpio_num_t)ignition_pin, HIGH);
+        esp_sleep_enable_ext1_wakeup(1ULL << charge_pin, ESP_EXT1_WAKEUP_ALL_LOW);
+        sleep_start = rtc_time_us();
+        esp_deep_sleep_start();
+    }
+
+    gpio_wakeup_enable((gpio_num_t)ignition_pin, GPIO_INTR_HIGH_LEVEL);
+    gpio_wakeup_enable((gpio_num_t)charge_pin, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+
+    sleep_start = rtc_time_us();
+    esp_light_sleep_start();
+    uint64_t slept = rtc_time_us() - sleep_start;
+
+    gpio_wakeup_disable((gpio_num_t)ignition_pin);
+    gpio_wakeup_disable((gpio_num_t)charge_pin);
+
+    wake_cause_t cause = to_wake_cause(esp_sleep_get_wakeup_cause());
+    record_wake(cause, slept);
+
+    return cause;
+}
+
+bool PowerManager::scan_pending() {
+    return health_scan_pending;
+}
+
+//call after each cell scan, only the first one after a wake is timed
+void PowerManager::first_scan_done() {
+    health_scan_pending = false;
+    if (!latency_pending) {
+        return;
+    }
+    latency_pending = false;
+    last_latency = micros() - wake_start;
+    if (last_latency > max_latency) {
+        max_latency = last_latency;
+    }
+}
+
+//percentage of time asleep since power on
+float PowerManager::residency() {
+    uint64_t uptime = rtc_time_us() - power_on_time;
+    if (!uptime) {
+        return 0;
+    }
+    return (float)total_sleep / uptime * 100;
+}
+
+void PowerManager::print_stats() {
+    pool_printf("sleep residency: %.1f%%, wakes gpio/timer: %u/%u, wake to scan: %uus (max %uus)\n",
+        residency(), gpio_wakes, timer_wakes, last_latency, max_latency);
+}
@@ -0,0 +1,41 @@
+/*
+Power manager for STANDBY. Puts the esp32 into light or deep sleep with wakeup
+from the ignition and charge pins and a slow timer for periodic health scans.
+Keeps sleep residency and wake to first scan latency so the savings can be checked.
+*/
+
+#ifndef POWER_h
+#define POWER_h
+
+#include <Arduino.h>
+
+const uint32_t HEALTH_SCAN_INTERVAL = 60; // in seconds, timer wakeup while parked
+const uint32_t MIN_AWAKE_TIME = 500; // in mseconds, lets the gpio job see a pin change before sleeping again
+
+enum power_sleep_t {SLEEP_LIGHT, SLEEP_DEEP};
+enum wake_cause_t {WAKE_NONE, WAKE_GPIO, WAKE_TIMER};
+
+class PowerManager {
+    public:
+        PowerManager(uint8_t ignition_pin, uint8_t charge_pin);
+        void begin(power_sleep_t mode);
+        bool can_sleep();
+        wake_cause_t sleep();
+        bool scan_pending();
+        void first_scan_done();
+        float residency();
+        void print_stats();
+    private:
+        uint8_t ignition_pin;
+        uint8_t charge_pin;
+        power_sleep_t mode;
+        uint32_t last_wake; // in mseconds
+        uint32_t wake_start; // in useconds
+        bool latency_pending;
+        bool health_scan_pending;
+        uint32_t last_latency; // in useconds
+        uint32_t max_latency; // in useconds
+        void record_wake(wake_cause_t cause, uint64_t slept);
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+Cyclic executive for the main loop. Jobs are released against absolute deadlines
+so the period doesn't drift with however long the other jobs take. Keeps execution
+time and deadline miss counters per job and feeds the task watchdog.
+*/
+
+#include <Arduino.h>
+#include <esp_task_wdt.h>
+#include <scheduler.h>
+#include <msg_pool.h>
+
+Scheduler::Scheduler() {
+    job_count = 0;
+}
+
+void Scheduler::begin() {
+    //arduino core may already have the twdt running for the idle tasks,
+    //in which case init fails harmlessly and the loop task just subscribes
+    esp_task_wdt_init(TASK_WDT_TIMEOUT, true);
+    esp_task_wdt_add(NULL);
+    resync();
+}
+
+//returns job id, or -1 if the job table is full
+int Scheduler::add_job(const char *name, job_fn_t fn, uint32_t period, uint8_t priority) {
+    if (job_count >= MAX_JOBS) {
+        return -1;
+    }
+
+    job_t *job = &jobs[job_count];
+    job->name = name;
+    job->fn = fn;
+    job->period = period;
+    job->priority = priority;
+    job->release = millis();
+    job->runs = 0;
+    job->misses = 0;
+    job->last_exec = 0;
+    job->max_exec = 0;
+    job->total_exec = 0;
+
+    return job_count++;
+}
+
+//releases every job now, used after start up or coming back from sleep so the
+//time spent away isn't counted as missed deadlines
+void Scheduler::resync() {
+    uint32_t now = millis();
+    for (int i = 0; i < job_count; i++) {
+        jobs[i].release = now;
+    }
+}
+
+//meant to be called from inside the job. release still holds the current run's
+//release then and run() adds the new period to it, so the new rate takes effect
+//from the next release without touching the deadline of this one
+void Scheduler::set_period(int id, uint32_t period) {
+    if (id < 0 || id >= job_count) {
+        return;
+    }
+    jobs[id].period = period;
+}
+
+//highest priority job that is due, earliest release breaks ties
+int Scheduler::next_ready(uint32_t now) {
+    int ready = -1;
+    for (int i = 0; i < job_count; i++) {
+        if ((int32_t)(now - jobs[i].release) < 0) {
+            continue;
+        }
+        if (ready < 0
+            || jobs[i].priority < jobs[ready].priority
+            || (jobs[i].priority == jobs[ready].priority
+                && (int32_t)(jobs[i].release - jobs[ready].release) < 0)) {
+            ready = i;
+        }
+    }
+    return ready;
+}
+
+uint32_t Scheduler::time_to_next(uint32_t now) {
+    uint32_t wait = MAX_IDLE_WAIT;
+    for (int i = 0; i < job_count; i++) {
+        int32_t until = (int32_t)(jobs[i].release - now);
+        if (until < 0) {
+            return 0;
+        }
+        if ((uint32_t)until < wait) {
+            wait = until;
+        }
+    }
+    return wait;
+}
+
+//runs at most one job per call, idles until the next release if nothing is due
+void Scheduler::run() {
+    uint32_t now = millis();
+    int id = next_ready(now);
+
+    esp_task_wdt_reset();
+
+    if (id < 0) {
+        //delay rather than spin so the idle task gets to run
+        delay(time_to_next(now));
+        return;
+    }
+
+    job_t *job = &jobs[id];
+    uint32_t start = micros();
+    job->fn();
+    uint32_t exec = micros() - start;
+
+    job->runs++;
+    job->last_exec = exec;
+    job->total_exec += exec;
+    if (exec > job->max_exec) {
+        job->max_exec = exec;
+    }
+
+    //deadline is the end of the period the job was released in
+    job->release += job->period;
+    uint32_t finish = millis();
+    if ((int32_t)(finish - job->release) > 0) {
+        job->misses++;
+        //drop the periods we can't catch up on but stay in phase
+        while ((int32_t)(finish - job->release) > 0) {
+            job->release += job->period;
+        }
+    }
+}
+
+void Scheduler::print_stats() {
+    pool_printf("job         period  runs    misses  last_us max_us  avg_us\n");
+    for (int i = 0; i < job_count; i++) {
+        job_t *job = &jobs[i];
+        uint32_t avg = job->runs ? job->total_exec / job->runs : 0;
+        pool_printf("%-11s %-7u %-7u %-7u %-7u %-7u %u\n", job->name, job->period,
+            job->runs, job->misses, job->last_exec, job->max_exec, avg);
+    }
+}
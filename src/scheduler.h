@@ -0,0 +1,47 @@
+/*
+Cyclic executive for the main loop. Jobs are released against absolute deadlines
+so the period doesn't drift with however long the other jobs take. Keeps execution
+time and deadline miss counters per job and feeds the task watchdog.
+*/
+
+#ifndef SCHEDULER_h
+#define SCHEDULER_h
+
+#include <Arduino.h>
+
+const uint8_t MAX_JOBS = 12;
+const uint8_t TASK_WDT_TIMEOUT = 5; // in seconds
+const uint32_t MAX_IDLE_WAIT = 50; // in mseconds, upper bound on a single idle delay
+
+typedef void (*job_fn_t)();
+
+typedef struct {
+    const char *name;
+    job_fn_t fn;
+    uint32_t period; // in mseconds
+    uint8_t priority; // lower number runs first when several jobs are due
+    uint32_t release; // absolute time the job is next due, in mseconds
+    uint32_t runs;
+    uint32_t misses; // finished after its deadline or skipped whole periods
+    uint32_t last_exec; // in useconds
+    uint32_t max_exec; // in useconds
+    uint64_t total_exec; // in useconds
+} job_t;
+
+class Scheduler {
+    public:
+        Scheduler();
+        void begin();
+        int add_job(const char *name, job_fn_t fn, uint32_t period, uint8_t priority);
+        void run();
+        void resync();
+        void set_period(int id, uint32_t period);
+        void print_stats();
+    private:
+        job_t jobs[MAX_JOBS];
+        uint8_t job_count;
+        int next_ready(uint32_t now);
+        uint32_t time_to_next(uint32_t now);
+};
+
+#endif
@@ -0,0 +1,148 @@
+/*
+Server-Sent Events telemetry on /events. One way stream with separate event
+types for cell tables, faults and soc, each decimated server side. Recent events
+are kept so a client reconnecting with Last-Event-ID gets what it missed, or a
+snapshot of the latest of each type if it has been away longer than that.
+*/
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <msg_pool.h>
+#include <sse.h>
+
+TelemetryStream::TelemetryStream(AsyncEventSource *events) {
+    this->events = events;
+    //ids start at 1, a client with no Last-Event-ID reports 0
+    next_id = 1;
+    head = 0;
+    mux = portMUX_INITIALIZER_UNLOCKED;
+    for(int i = 0; i < SSE_STREAMS; i++) {
+        ticks[i] = 0;
+        latest[i].id = 0;
+    }
+    for(int i = 0; i < SSE_HISTORY; i++) {
+        history[i].id = 0;
+    }
+}
+
+void TelemetryStream::begin() {
+    events->onConnect([this](AsyncEventSourceClient *client) {
+        replay(client);
+    });
+}
+
+//call once per telemetry period before checking due()
+void TelemetryStream::tick() {
+    for(int i = 0; i < SSE_STREAMS; i++) {
+        ticks[i]++;
+    }
+}
+
+bool TelemetryStream::due(sse_stream_t stream) {
+    if (ticks[stream] < SSE_DECIMATION[stream]) {
+        return false;
+    }
+    ticks[stream] = 0;
+    return true;
+}
+
+//the event source builds a heap message per send, so skip it with nobody listening
+bool TelemetryStream::has_clients() {
+    return events->count() > 0;
+}
+
+//stores the event for resume and sends it to connected clients
+bool TelemetryStream::publish(sse_stream_t stream, const char *data) {
+    size_t len = strlen(data);
+    if (len >= SSE_MSG_LEN) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&mux);
+    uint32_t id = next_id++;
+    sse_event_t *event = &history[head];
+    event->id = id;
+    event->stream = stream;
+    memcpy(event->data, data, len + 1);
+    head = (head + 1) % SSE_HISTORY;
+    latest[stream] = *event;
+    portEXIT_CRITICAL(&mux);
+
+    if (has_clients()) {
+        events->send(data, SSE_EVENT_NAMES[stream], id, SSE_RECONNECT);
+    }
+    return true;
+}
+
+//runs on the async tcp task. history is copied out a pool block at a time so
+//the loop is never blocked behind a client send
+void TelemetryStream::replay(AsyncEventSourceClient *client) {
+    uint32_t last_id = client->lastId();
+    if (!last_id) {
+        return;
+    }
+
+    char *buff = msg_pool.alloc();
+    if (!buff) {
+        return;
+    }
+
+    //slot at head is the oldest once the ring has wrapped, until then slot 0 is
+    portENTER_CRITICAL(&mux);
+    uint32_t oldest = history[head].id ? history[head].id : history[0].id;
+    uint32_t newest = next_id - 1;
+    portEXIT_CRITICAL(&mux);
+
+    //events between last_id and the oldest kept one are gone, replaying the
+    //rest would leave the client with a hole it can't see. a last_id past the
+    //newest means we rebooted and the ids started over
+    if (oldest > last_id + 1 || last_id > newest) {
+        snapshot(client, last_id, buff);
+        msg_pool.release(buff);
+        return;
+    }
+
+    //oldest first, starting from the slot about to be overwritten
+    for(int n = 0; n < SSE_HISTORY; n++) {
+        uint32_t id;
+        uint8_t stream;
+
+        portENTER_CRITICAL(&mux);
+        sse_event_t *event = &history[(head + n) % SSE_HISTORY];
+        id = event->id;
+        stream = event->stream;
+        if (id > last_id) {
+            memcpy(buff, event->data, SSE_MSG_LEN);
+        }
+        portEXIT_CRITICAL(&mux);
+
+        if (id > last_id) {
+            client->send(buff, SSE_EVENT_NAMES[stream], id, SSE_RECONNECT);
+        }
+    }
+
+    msg_pool.release(buff);
+}
+
+//tells the client it missed events then sends the current state of each type.
+//sent without ids so the client's Last-Event-ID stays put until the next live
+//event, which then carries on from the newest id
+void TelemetryStream::snapshot(AsyncEventSourceClient *client, uint32_t last_id, char *buff) {
+    snprintf(buff, SSE_MSG_LEN, "{\"last_id\":%u}", last_id);
+    client->send(buff, "resync", 0, SSE_RECONNECT);
+
+    for(int i = 0; i < SSE_STREAMS; i++) {
+        bool valid;
+
+        portENTER_CRITICAL(&mux);
+        valid = latest[i].id != 0;
+        if (valid) {
+            memcpy(buff, latest[i].data, SSE_MSG_LEN);
+        }
+        portEXIT_CRITICAL(&mux);
+
+        if (valid) {
+            client->send(buff, SSE_EVENT_NAMES[i], 0, SSE_RECONNECT);
+        }
+    }
+}
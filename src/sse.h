@@ -0,0 +1,51 @@
+/*
+Server-Sent Events telemetry on /events. One way stream with separate event
+types for cell tables, faults and soc, each decimated server side. Recent events
+are kept so a client reconnecting with Last-Event-ID gets what it missed, or a
+snapshot of the latest of each type if it has been away longer than that.
+*/
+
+#ifndef SSE_h
+#define SSE_h
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+enum sse_stream_t {SSE_CELLS, SSE_FAULTS, SSE_SOC, SSE_STREAMS};
+
+//indexed by sse_stream_t
+const char *const SSE_EVENT_NAMES[SSE_STREAMS] = {"cells", "faults", "soc"};
+const uint8_t SSE_DECIMATION[SSE_STREAMS] = {2, 4, 4}; // publish every nth tick, faults also on change
+
+//~4 events a second at a 250ms tick, enough for twice the retry interval
+const uint8_t SSE_HISTORY = 16; // events kept for Last-Event-ID resume
+const size_t SSE_MSG_LEN = 448; // built in msg pool blocks so no bigger than MSG_BLOCK_SIZE
+const uint32_t SSE_RECONNECT = 2000; // in mseconds, retry hint sent to clients
+
+typedef struct {
+    uint32_t id;
+    uint8_t stream;
+    char data[SSE_MSG_LEN];
+} sse_event_t;
+
+class TelemetryStream {
+    public:
+        TelemetryStream(AsyncEventSource *events);
+        void begin();
+        void tick();
+        bool due(sse_stream_t stream);
+        bool publish(sse_stream_t stream, const char *data);
+        bool has_clients();
+    private:
+        AsyncEventSource *events;
+        uint32_t next_id;
+        uint8_t ticks[SSE_STREAMS];
+        sse_event_t history[SSE_HISTORY];
+        sse_event_t latest[SSE_STREAMS]; // newest of each type, for the snapshot
+        uint8_t head; // next slot to write
+        portMUX_TYPE mux;
+        void replay(AsyncEventSourceClient *client);
+        void snapshot(AsyncEventSourceClient *client, uint32_t last_id, char *buff);
+};
+
+#endif